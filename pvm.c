@@ -5,14 +5,30 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <endian.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/mman.h>
 
 #define KPAGECOUNT_PATH "/proc/kpagecount"
 #define KPAGEFLAGS_PATH "/proc/kpageflags"
+#define PAGE_IDLE_PATH "/sys/kernel/mm/page_idle/bitmap"
 
 #define PAGEMAP_LENGTH 8
-#define PAGESIZE 4096
 #define PAGEMAP_ENTRY_SIZE 8
-#define ENTRY_PER_PAGE 512
+#define MAX_PAGING_LEVELS 5
+#define IDLE_BATCH_WORDS 512    // page_idle bitmap words per read/write
+#define IDLE_GAP_WORDS 8        // untouched words tolerated inside one batch
+#define KPAGECOUNT_BATCH 512    // kpagecount entries per read
+
+// Paging geometry of the running system, filled in by init_paging()
+uint64_t page_size = 4096;
+int page_shift = 12;
+uint64_t entries_per_page = 512;    // page table entries in one table frame
+
+enum output_format { FORMAT_TEXT, FORMAT_JSONL, FORMAT_BIN };
+enum output_format output_format = FORMAT_TEXT;
 
 // Function prototypes
 void frameinfo(uint64_t pfn);
@@ -23,19 +39,121 @@ void maprange(int pid, uint64_t va1, uint64_t va2);
 void mapall(int pid);
 void mapallin(int pid);
 void alltablesize(int pid);
+void wss(int pid, int interval);
+void contiguity(int pid);
+void swapmap(int pid);
+void fileres(const char* target);
 
+void init_paging(void);
+int detect_paging_levels(int pid);
 uint64_t pfn_va_formatter(char* arg);
 
+// Diagnostics stay on stdout for the text output but must not end up in
+// the middle of a jsonl or bin stream.
+FILE* diag(void)
+{
+    return output_format == FORMAT_TEXT ? stdout : stderr;
+}
+
+void init_paging(void)
+{
+    long size = sysconf(_SC_PAGESIZE);
+    if (size <= 0)
+    {
+        size = 4096;
+    }
+
+    page_size = (uint64_t) size;
+    page_shift = __builtin_ctzll(page_size);
+    entries_per_page = page_size / PAGEMAP_ENTRY_SIZE;
+}
+
+// Returns the end of a page mapped as high as the kernel allows, or 0.
+// x86-64 LA57 and arm64 52-bit kernels keep the stack and default mmaps
+// below 2^47 (2^48 on arm64) and only go above when a hint asks for it.
+// 2^51 lies above both windows and inside every wider user space, so it is
+// honoured exactly on those kernels and ignored on 4-level ones.
+uint64_t probe_user_top(void)
+{
+    void* page = mmap((void*) (1ULL << 51), page_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (page == MAP_FAILED)
+    {
+        return 0;
+    }
+    munmap(page, page_size);
+    return (uint64_t) page + page_size;
+}
+
+// The paging depth is not exported by /proc, so derive it from the widest
+// user address: the highest one in maps or, as almost no process maps above
+// the default window, the probe above. On x86-64 user space is the lower,
+// sign-extended half of a 48-bit (4-level) or 57-bit (LA57, 5-level) space;
+// arm64 gives user space the full VA_BITS range, so the width of the highest
+// user address is VA_BITS itself (52 with LPA2, 5 levels on 4K pages).
+int detect_paging_levels(int pid)
+{
+    char maps_file[64];
+    sprintf(maps_file, "/proc/%d/maps", pid);
+
+    uint64_t highest = 0;
+    FILE* maps = fopen(maps_file, "r");
+    if (maps != NULL)
+    {
+        char line[512];
+        while (fgets(line, sizeof(line), maps) != NULL)
+        {
+            uint64_t start, end;
+            // skip kernel-half entries such as [vsyscall]
+            if (sscanf(line, "%lx-%lx", &start, &end) == 2 && !(start >> 63) && end > highest)
+            {
+                highest = end;
+            }
+        }
+        fclose(maps);
+    }
+    uint64_t top = probe_user_top();
+    if (top > highest)
+    {
+        highest = top;
+    }
+
+    int va_bits = highest > 1 ? 64 - __builtin_clzll(highest - 1) : 0;
+#if defined(__x86_64__)
+    va_bits++;              // sign bit of the canonical address
+    if (va_bits < 48)
+    {
+        va_bits = 48;
+    }
+#endif
+
+    int bits_per_level = page_shift - 3;
+    int levels = (va_bits - page_shift + bits_per_level - 1) / bits_per_level;
+    if (levels < 2)
+    {
+        levels = 2;
+    }
+    return levels > MAX_PAGING_LEVELS ? MAX_PAGING_LEVELS : levels;
+}
+
 uint64_t get_entry_frame(uint64_t entry) {
     return entry & 0x7FFFFFFFFFFFFF;
 }
 
+// Swapped pages store the swap type in bits 0-4 and the offset in bits 5-54
+uint64_t get_swap_type(uint64_t entry) {
+    return entry & 0x1F;
+}
+
+uint64_t get_swap_offset(uint64_t entry) {
+    return (entry >> 5) & 0x3FFFFFFFFFFFF;
+}
+
 uint64_t get_frame_flags(uint64_t pfn) 
 {
     int kpageflags_fd = open(KPAGEFLAGS_PATH, O_RDONLY);
     if (kpageflags_fd == -1) 
     {
-        printf("Could not open kpageflags file\n");
+        fprintf(diag(), "Could not open kpageflags file\n");
         return 0;
     }
 
@@ -54,7 +172,7 @@ uint64_t get_mapping_count(uint64_t pfn)
     int kpagecount_fd = open(KPAGECOUNT_PATH, O_RDONLY);
     if (kpagecount_fd == -1) 
     {
-        printf("Could not open kpagecount file\n");
+        fprintf(diag(), "Could not open kpagecount file\n");
         return 0;
     }
 
@@ -68,6 +186,497 @@ uint64_t get_mapping_count(uint64_t pfn)
     return pagecount;
 }
 
+#define PAGEMAP_BATCH 4096      // pagemap entries fetched per read
+
+struct vma {
+    uint64_t start;
+    uint64_t end;
+    uint64_t offset;
+    unsigned int major;
+    unsigned int minor;
+    uint64_t inode;
+    char name[256];
+};
+
+// Parses one line of a maps file; returns false if it is malformed
+bool parse_vma(const char* line, struct vma* vma)
+{
+    vma->name[0] = '\0';
+    return sscanf(line, "%lx-%lx %*s %lx %x:%x %lu %255s", &vma->start, &vma->end,
+                  &vma->offset, &vma->major, &vma->minor, &vma->inode, vma->name) >= 6;
+}
+
+// Reads the maps file of pid into a malloc'ed array; returns the number of
+// VMAs, or -1 if the file cannot be opened.
+int read_vmas(int pid, struct vma** vmas)
+{
+    char maps_file[64];
+    sprintf(maps_file, "/proc/%d/maps", pid);
+
+    FILE* maps = fopen(maps_file, "r");
+    if (maps == NULL)
+    {
+        return -1;
+    }
+
+    int count = 0, capacity = 64;
+    *vmas = malloc(capacity * sizeof(struct vma));
+
+    char line[512];
+    while (fgets(line, sizeof(line), maps) != NULL)
+    {
+        if (count == capacity)
+        {
+            capacity *= 2;
+            *vmas = realloc(*vmas, capacity * sizeof(struct vma));
+        }
+        if (parse_vma(line, &(*vmas)[count]))
+        {
+            count++;
+        }
+    }
+
+    fclose(maps);
+    return count;
+}
+
+// Reads the pagemap entries of n pages starting at vpn with one pread.
+// Returns the number of entries read.
+uint64_t read_pagemap(int pagemap, uint64_t vpn, uint64_t n, uint64_t* entries)
+{
+    ssize_t bytes = pread(pagemap, entries, n * PAGEMAP_ENTRY_SIZE, vpn * PAGEMAP_ENTRY_SIZE);
+    return bytes > 0 ? bytes / PAGEMAP_ENTRY_SIZE : 0;
+}
+
+// Streams the pagemap entries of every VMA of a process in batches:
+//
+//     struct pagemap_iter it;
+//     if (pagemap_iter_open(&it, pid) < 0) ...
+//     while (pagemap_iter_next(&it))
+//         ... it.entries[0 .. it.n) describe pages it.vpn.. of it.vmas[it.v]
+//     pagemap_iter_close(&it);
+//
+// Batches never span two VMAs. When want is set, VMAs it rejects are skipped
+// without reading their pagemap. Without CAP_SYS_ADMIN the kernel zeroes frame
+// numbers and swap entries; the walk then stops early with hidden set.
+struct pagemap_iter {
+    struct vma* vmas;
+    int vma_count;
+    int v;                  // VMA of the current batch
+    uint64_t vpn;           // first page of the current batch
+    uint64_t n;             // entries in the current batch
+    uint64_t* entries;
+    bool (*want)(const struct vma* vma);
+    bool hidden;
+    int pagemap;
+    uint64_t next_vpn;
+};
+
+enum { ITER_NO_MAPS = -1, ITER_NO_PAGEMAP = -2, ITER_HIDDEN = -3 };
+
+int pagemap_iter_open(struct pagemap_iter* it, int pid)
+{
+    memset(it, 0, sizeof(*it));
+    it->vma_count = read_vmas(pid, &it->vmas);
+    if (it->vma_count < 0)
+    {
+        return ITER_NO_MAPS;
+    }
+
+    char pagemap_file[64];
+    sprintf(pagemap_file, "/proc/%d/pagemap", pid);
+    it->pagemap = open(pagemap_file, O_RDONLY);
+    if (it->pagemap < 0)
+    {
+        free(it->vmas);
+        return ITER_NO_PAGEMAP;
+    }
+
+    it->entries = malloc(PAGEMAP_BATCH * sizeof(uint64_t));
+    it->v = -1;
+    return 0;
+}
+
+bool pagemap_iter_next(struct pagemap_iter* it)
+{
+    while (it->v < it->vma_count)
+    {
+        if (it->v >= 0)
+        {
+            uint64_t end = it->vmas[it->v].end >> page_shift;
+            if (it->next_vpn < end)
+            {
+                uint64_t count = end - it->next_vpn < PAGEMAP_BATCH ? end - it->next_vpn : PAGEMAP_BATCH;
+                it->vpn = it->next_vpn;
+                it->n = read_pagemap(it->pagemap, it->vpn, count, it->entries);
+                if (it->n > 0)
+                {
+                    for (uint64_t i = 0; i < it->n; i++)
+                    {
+                        uint64_t entry = it->entries[i];
+                        if (entry >> 62 && get_entry_frame(entry) == 0)
+                        {
+                            it->hidden = true;
+                            return false;
+                        }
+                    }
+                    it->next_vpn += it->n;
+                    return true;
+                }
+            }
+        }
+
+        // move on to the next wanted VMA
+        do
+        {
+            it->v++;
+        } while (it->v < it->vma_count && it->want && !it->want(&it->vmas[it->v]));
+        if (it->v < it->vma_count)
+        {
+            it->next_vpn = it->vmas[it->v].start >> page_shift;
+        }
+    }
+    return false;
+}
+
+void pagemap_iter_close(struct pagemap_iter* it)
+{
+    close(it->pagemap);
+    free(it->entries);
+    free(it->vmas);
+}
+
+void report_iter_error(int status)
+{
+    if (status == ITER_NO_MAPS)
+        fprintf(diag(), "Failed to open maps file\n");
+    else if (status == ITER_NO_PAGEMAP)
+        fprintf(diag(), "Failed to open pagemap file\n");
+    else
+        fprintf(diag(), "Frame numbers and swap entries are hidden by the kernel; run as root\n");
+}
+
+// Machine-readable output (--format=jsonl|bin).
+//
+// Mapping rows are run-length coded: a record stands for `count` consecutive
+// pages of the same VMA with the same flags whose frame numbers also advance
+// by one (or which are all without a frame). `flags` holds pagemap bits 55-63
+// shifted down (bit 0 soft-dirty, 1 exclusive, 6 file/shared-anon, 7 swapped,
+// 8 present) and `pfn` the low 55 bits, i.e. the swap entry for swapped pages.
+// Frame rows carry the kpageflags word and the kpagecount value instead.
+// Summary values are stat rows: `label` indexes the label table for the name
+// of the value, `count` holds it and `vma_id` is the VMA (or, for -fileres,
+// the file) it describes, PVM_NO_VMA for totals.
+//
+// The bin layout is a header, record_count fixed-width records, the VMA
+// table, the label table and finally the string blob both tables point into.
+// File entries of -fileres have start == end == 0.
+// All fields are little-endian. The header is rewritten with the final counts
+// when stdout is seekable, and a copy of it always closes the file, so a
+// reader of piped output finds it in the last sizeof(struct pvm_bin_header)
+// bytes.
+
+#define PVM_BIN_MAGIC "PVMB"
+#define PVM_BIN_VERSION 1
+#define PVM_NO_VMA 0xFFFFFFFFu
+#define PVM_NO_LABEL 0xFFFFu
+
+enum record_kind { RECORD_MAPPING, RECORD_FRAME, RECORD_STAT };
+enum pvm_command { CMD_FRAMEINFO = 1, CMD_MEMUSED, CMD_MAPVA, CMD_PTE, CMD_MAPRANGE,
+                   CMD_MAPALL, CMD_MAPALLIN, CMD_ALLTABLESIZE, CMD_WSS,
+                   CMD_CONTIGUITY, CMD_SWAPMAP, CMD_FILERES };
+
+struct pvm_bin_header {
+    char magic[4];
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t page_shift;
+    uint32_t command;
+    uint64_t record_count;
+    uint32_t vma_count;
+    uint32_t label_count;
+    uint64_t vma_table_offset;
+    uint64_t label_table_offset;
+    uint64_t string_offset;
+};
+
+struct pvm_bin_record {
+    uint64_t vpn;
+    uint64_t pfn;
+    uint64_t flags;
+    uint64_t count;
+    uint32_t vma_id;
+    uint16_t kind;
+    uint16_t label;
+};
+
+struct pvm_bin_vma {
+    uint64_t start;
+    uint64_t end;
+    uint64_t offset;        // file offset of start
+    uint64_t inode;
+    uint32_t major;
+    uint32_t minor;
+    uint32_t name_offset;   // into the string blob
+    uint32_t name_length;
+};
+
+struct pvm_bin_label {
+    uint32_t name_offset;
+    uint32_t name_length;
+};
+
+struct output_state {
+    int command;
+    uint64_t record_count;
+    struct pvm_bin_record run;      // pending mapping run, run.count == 0 if none
+    struct pvm_bin_vma *vmas;
+    uint32_t vma_count;
+    uint32_t vma_capacity;
+    struct pvm_bin_label *labels;
+    uint32_t label_count;
+    uint32_t label_capacity;
+    char *strings;
+    uint32_t strings_length;
+    uint32_t strings_capacity;
+    int64_t last_vma;
+} out;
+
+void out_header(FILE* fp)
+{
+    uint64_t vma_table = sizeof(struct pvm_bin_header) + out.record_count * sizeof(struct pvm_bin_record);
+    uint64_t label_table = vma_table + out.vma_count * sizeof(struct pvm_bin_vma);
+
+    struct pvm_bin_header header;
+    memcpy(header.magic, PVM_BIN_MAGIC, 4);
+    header.version = htole16(PVM_BIN_VERSION);
+    header.record_size = htole16(sizeof(struct pvm_bin_record));
+    header.page_shift = htole32(page_shift);
+    header.command = htole32(out.command);
+    header.record_count = htole64(out.record_count);
+    header.vma_count = htole32(out.vma_count);
+    header.label_count = htole32(out.label_count);
+    header.vma_table_offset = htole64(vma_table);
+    header.label_table_offset = htole64(label_table);
+    header.string_offset = htole64(label_table + out.label_count * sizeof(struct pvm_bin_label));
+    fwrite(&header, sizeof(header), 1, fp);
+}
+
+void json_string(const char* s)
+{
+    putchar('"');
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            printf("\\%c", *s);
+        else if ((unsigned char) *s < 0x20)
+            printf("\\u%04x", *s);
+        else
+            putchar(*s);
+    }
+    putchar('"');
+}
+
+void out_begin(int command)
+{
+    memset(&out, 0, sizeof(out));
+    out.command = command;
+    out.last_vma = -1;
+    if (output_format == FORMAT_BIN)
+    {
+        out_header(stdout);
+    }
+}
+
+void out_record(const struct pvm_bin_record* r)
+{
+    static const char* kind_names[] = { "mapping", "frame", "stat" };
+
+    out.record_count++;
+    if (output_format == FORMAT_BIN)
+    {
+        struct pvm_bin_record le = {
+            htole64(r->vpn), htole64(r->pfn), htole64(r->flags), htole64(r->count),
+            htole32(r->vma_id), htole16(r->kind), htole16(r->label)
+        };
+        fwrite(&le, sizeof(le), 1, stdout);
+        return;
+    }
+
+    printf("{\"kind\":\"%s\"", kind_names[r->kind]);
+    if (r->kind == RECORD_STAT)
+    {
+        printf(",\"name\":");
+        json_string(out.strings + out.labels[r->label].name_offset);
+        if (r->vma_id != PVM_NO_VMA)
+        {
+            printf(",\"vma\":%u", r->vma_id);
+        }
+        printf(",\"value\":%lu}\n", r->count);
+        return;
+    }
+    if (r->kind == RECORD_MAPPING)
+    {
+        printf(",\"vpn\":%lu", r->vpn);
+    }
+    printf(",\"pfn\":%lu,\"flags\":%lu,\"count\":%lu", r->pfn, r->flags, r->count);
+    if (r->vma_id != PVM_NO_VMA)
+    {
+        printf(",\"vma\":%u", r->vma_id);
+    }
+    printf("}\n");
+}
+
+void out_flush_run(void)
+{
+    if (out.run.count)
+    {
+        out_record(&out.run);
+        out.run.count = 0;
+    }
+}
+
+// Appends name to the string blob and returns its offset
+uint32_t out_string(const char* name)
+{
+    uint32_t length = strlen(name);
+    while (out.strings_length + length + 1 > out.strings_capacity)
+    {
+        out.strings_capacity = out.strings_capacity ? out.strings_capacity * 2 : 4096;
+        out.strings = realloc(out.strings, out.strings_capacity);
+    }
+    uint32_t offset = out.strings_length;
+    memcpy(out.strings + offset, name, length + 1);
+    out.strings_length += length + 1;
+    return offset;
+}
+
+// Returns the id of a stat label, adding it to the label table the first time
+uint16_t out_label(const char* name)
+{
+    for (uint32_t i = 0; i < out.label_count; i++)
+    {
+        if (!strcmp(out.strings + out.labels[i].name_offset, name))
+        {
+            return i;
+        }
+    }
+
+    if (out.label_count == out.label_capacity)
+    {
+        out.label_capacity = out.label_capacity ? out.label_capacity * 2 : 32;
+        out.labels = realloc(out.labels, out.label_capacity * sizeof(struct pvm_bin_label));
+    }
+    out.labels[out.label_count].name_offset = out_string(name);
+    out.labels[out.label_count].name_length = strlen(name);
+    return out.label_count++;
+}
+
+// Registers the VMA at position `index` of the maps file (or the file at
+// position `index` of a -fileres report) once; its id in the VMA table is
+// returned for use in mapping and stat rows.
+uint32_t out_vma(int64_t index, const struct vma* vma)
+{
+    if (index == out.last_vma)
+    {
+        return out.vma_count - 1;
+    }
+    out_flush_run();
+    out.last_vma = index;
+
+    if (out.vma_count == out.vma_capacity)
+    {
+        out.vma_capacity = out.vma_capacity ? out.vma_capacity * 2 : 64;
+        out.vmas = realloc(out.vmas, out.vma_capacity * sizeof(struct pvm_bin_vma));
+    }
+    uint32_t id = out.vma_count++;
+    out.vmas[id] = (struct pvm_bin_vma) {
+        vma->start, vma->end, vma->offset, vma->inode, vma->major, vma->minor,
+        out_string(vma->name), strlen(vma->name)
+    };
+
+    if (output_format == FORMAT_JSONL)
+    {
+        printf("{\"kind\":\"vma\",\"vma\":%u,\"start\":%lu,\"end\":%lu,\"offset\":%lu,"
+               "\"dev\":\"%02x:%02x\",\"inode\":%lu,\"name\":",
+               id, vma->start, vma->end, vma->offset,
+               vma->major, vma->minor, vma->inode);
+        json_string(vma->name);
+        printf("}\n");
+    }
+    return id;
+}
+
+void out_mapping(uint64_t vpn, uint64_t entry, uint32_t vma_id)
+{
+    uint64_t pfn = get_entry_frame(entry);
+    uint64_t flags = entry >> 55;
+    struct pvm_bin_record* run = &out.run;
+
+    if (run->count && run->vma_id == vma_id && run->flags == flags &&
+        vpn == run->vpn + run->count &&
+        ((flags >> 8) ? pfn == run->pfn + run->count : pfn == 0 && run->pfn == 0))
+    {
+        run->count++;
+        return;
+    }
+    out_flush_run();
+    *run = (struct pvm_bin_record) { vpn, pfn, flags, 1, vma_id, RECORD_MAPPING, PVM_NO_LABEL };
+}
+
+void out_frame(uint64_t pfn, uint64_t flags, uint64_t count)
+{
+    struct pvm_bin_record r = { 0, pfn, flags, count, PVM_NO_VMA, RECORD_FRAME, PVM_NO_LABEL };
+    out_record(&r);
+}
+
+void out_vma_stat(uint32_t vma_id, const char* name, uint64_t value)
+{
+    out_flush_run();
+    struct pvm_bin_record r = { 0, 0, 0, value, vma_id, RECORD_STAT, out_label(name) };
+    out_record(&r);
+}
+
+void out_stat(const char* name, uint64_t value)
+{
+    out_vma_stat(PVM_NO_VMA, name, value);
+}
+
+void out_end(void)
+{
+    out_flush_run();
+    if (output_format == FORMAT_BIN)
+    {
+        for (uint32_t i = 0; i < out.vma_count; i++)
+        {
+            struct pvm_bin_vma* v = &out.vmas[i];
+            struct pvm_bin_vma le = {
+                htole64(v->start), htole64(v->end), htole64(v->offset), htole64(v->inode),
+                htole32(v->major), htole32(v->minor), htole32(v->name_offset), htole32(v->name_length)
+            };
+            fwrite(&le, sizeof(le), 1, stdout);
+        }
+        for (uint32_t i = 0; i < out.label_count; i++)
+        {
+            struct pvm_bin_label le = {
+                htole32(out.labels[i].name_offset), htole32(out.labels[i].name_length)
+            };
+            fwrite(&le, sizeof(le), 1, stdout);
+        }
+        fwrite(out.strings, 1, out.strings_length, stdout);
+        out_header(stdout);
+        if (fseek(stdout, 0, SEEK_SET) == 0)
+        {
+            out_header(stdout);
+        }
+    }
+    fflush(stdout);
+    free(out.vmas);
+    free(out.labels);
+    free(out.strings);
+    memset(&out, 0, sizeof(out));
+}
+
 void frameinfo(uint64_t pfn) 
 {    
     const char* flag_names[] = {
@@ -78,6 +687,14 @@ void frameinfo(uint64_t pfn)
     };
 
     uint64_t flags = get_frame_flags(pfn);
+    if (output_format != FORMAT_TEXT)
+    {
+        out_begin(CMD_FRAMEINFO);
+        out_frame(pfn, flags, get_mapping_count(pfn));
+        out_end();
+        return;
+    }
+
     int num_flags = sizeof(flag_names) / sizeof(flag_names[0]);
     int five_cnt = 0;
     for (int i = 0; i < num_flags; i++) 
@@ -161,10 +778,10 @@ void memused(int pid)
                 continue;
             }
 
-            for (uint64_t i = startAddr; i < endAddr; i += PAGESIZE) 
+            for (uint64_t i = startAddr; i < endAddr; i += page_size) 
             {
               // find the frame number
-              uint64_t offset = i / PAGESIZE * sizeof(uint64_t);
+              uint64_t offset = (i >> page_shift) * sizeof(uint64_t);
               lseek(pagemapfile, offset, SEEK_SET);
               uint64_t entry;
               read(pagemapfile, &entry, sizeof(uint64_t));
@@ -185,23 +802,35 @@ void memused(int pid)
 
                 if (count == 1) 
                 {
-                    exclusivePM += PAGESIZE;
+                    exclusivePM += page_size;
                 }
                 if (count >= 1) 
                 {
-                  totalPM += PAGESIZE;
+                  totalPM += page_size;
                 }
                 close(kpagecount);
               }
-              totalVM += PAGESIZE;
+              totalVM += page_size;
             }
             close(pagemapfile);
         }
         free(firstPart);
         free(secondPart);
     }
-    //totalPM += PAGESIZE;
-    printf("(pid=%d) memused: virtual=%ld KB, pmem_all=%ld KB, pmem_alone=%ld KB, mappedonce=%ld KB\n",pid,totalVM/1024,totalPM/1024,exclusivePM/1024,exclusivePM/1024);
+    //totalPM += page_size;
+    if (output_format != FORMAT_TEXT)
+    {
+        out_begin(CMD_MEMUSED);
+        out_stat("virtual_kb", totalVM / 1024);
+        out_stat("pmem_all_kb", totalPM / 1024);
+        out_stat("pmem_alone_kb", exclusivePM / 1024);
+        out_stat("mappedonce_kb", exclusivePM / 1024);
+        out_end();
+    }
+    else
+    {
+        printf("(pid=%d) memused: virtual=%ld KB, pmem_all=%ld KB, pmem_alone=%ld KB, mappedonce=%ld KB\n",pid,totalVM/1024,totalPM/1024,exclusivePM/1024,exclusivePM/1024);
+    }
 
     // Close the file
     fclose(mapfile);
@@ -215,24 +844,32 @@ void mapva(int pid, uint64_t va) {
 
     pagemap = fopen(pagemap_file, "r");
     if (pagemap == NULL) {
-        printf("Failed to open pagemap file\n");
+        fprintf(diag(), "Failed to open pagemap file\n");
         return;
     }
 
     // Find the corresponding physical address
-    uint64_t virt_page_num = va / PAGESIZE;
+    uint64_t virt_page_num = va >> page_shift;
     fseek(pagemap, virt_page_num * PAGEMAP_ENTRY_SIZE, SEEK_SET);
     uint64_t pagemap_entry;
     if (fread(&pagemap_entry, PAGEMAP_LENGTH, 1, pagemap) != 1) {
-        printf("Failed to read pagemap entry for VA 0x%lx\n", va);
+        fprintf(diag(), "Failed to read pagemap entry for VA 0x%lx\n", va);
         fclose(pagemap);
         return;
     }
-    uint64_t physical_address = get_entry_frame(pagemap_entry) * PAGESIZE + (va % PAGESIZE);
+    uint64_t physical_address = (get_entry_frame(pagemap_entry) << page_shift) + (va & (page_size - 1));
     uint64_t fnum = get_entry_frame(pagemap_entry);
 
     fclose(pagemap);
 
+    if (output_format != FORMAT_TEXT)
+    {
+        out_begin(CMD_MAPVA);
+        out_mapping(virt_page_num, pagemap_entry, PVM_NO_VMA);
+        out_end();
+        return;
+    }
+
     // Print the physical address and frame number in hexadecimal format
     printf("va=0x%012lx: physical_address=0x%016lx, fnum=0x%09lx\n", va, physical_address, fnum);
 }
@@ -245,26 +882,34 @@ void pte(int pid, uint64_t va)
     int pagemap = open(pagemap_file, O_RDONLY);
     if (pagemap < 0) 
     {
-        printf("Failed to open pagemap file\n");
+        fprintf(diag(), "Failed to open pagemap file\n");
         return;
     }
 
-    uint64_t virt_page_num = va / PAGESIZE;
+    uint64_t virt_page_num = va >> page_shift;
 
     uint64_t pagemap_entry;
     lseek(pagemap, virt_page_num * PAGEMAP_ENTRY_SIZE, SEEK_SET);
     if (read(pagemap, &pagemap_entry, PAGEMAP_LENGTH) != PAGEMAP_LENGTH) 
     {
-        printf("Failed to read pagemap entry\n");
+        fprintf(diag(), "Failed to read pagemap entry\n");
         close(pagemap);
         return;
     }
 
     close(pagemap);
 
+    if (output_format != FORMAT_TEXT)
+    {
+        out_begin(CMD_PTE);
+        out_mapping(virt_page_num, pagemap_entry, PVM_NO_VMA);
+        out_end();
+        return;
+    }
+
     printf("[vaddr=0x%012lx, vpn=0x%09lx]: present=%d, swapped=%d, file-anon=%d, exclusive=%d, softdirty=%d, number=0x%09lx\n",
             va,                                     //Pagemap entry for VA
-            va >> 12,                               //Page frame number
+            va >> page_shift,                       //Virtual page number
             (pagemap_entry & (1ULL << 63)) != 0,    //Present
             (pagemap_entry & (1ULL << 62)) != 0,    //Swapped
             (pagemap_entry & (1ULL << 61)) != 0,    //File-page of shared-anon
@@ -282,32 +927,56 @@ void pte(int pid, uint64_t va)
     */
     if (pagemap_entry & (1ULL << 62)) 
     {   // page is swapped
-        uint64_t swap_offset = (pagemap_entry >> 5) & 0x3FFFFFFFFFF;
-        uint64_t swap_type = pagemap_entry & 0x1F;
+        uint64_t swap_offset = get_swap_offset(pagemap_entry);
+        uint64_t swap_type = get_swap_type(pagemap_entry);
         printf("Swap offset: 0x%lx\n", swap_offset);
         printf("Swap type: 0x%lx\n", swap_type);
     }
 }
 
-int is_va_used(uint64_t va, const char* maps_file) {
+// Returns the position of the VMA containing va in the maps file, or -1.
+// The VMA is copied to vma when not NULL; if va is not mapped, vma receives
+// the bounds of the hole around it instead.
+int64_t find_vma(uint64_t va, const char* maps_file, struct vma* vma) {
+    uint64_t gap_start = 0, gap_end = UINT64_MAX;
+    if (vma) {
+        memset(vma, 0, sizeof(*vma));
+        vma->end = gap_end;
+    }
+
     FILE* maps = fopen(maps_file, "r");
     if (maps == NULL) {
-        printf("Failed to open maps file\n");
-        return 0;
+        fprintf(diag(), "Failed to open maps file\n");
+        return -1;
     }
 
     char line[512];
-    while (fgets(line, sizeof(line), maps) != NULL) {
-        uint64_t start, end;
-        sscanf(line, "%lx-%lx", &start, &end);
-        if (va >= start && va < end) {
+    for (int64_t index = 0; fgets(line, sizeof(line), maps) != NULL; index++) {
+        uint64_t vma_start, vma_end;
+        sscanf(line, "%lx-%lx", &vma_start, &vma_end);
+        if (vma_end <= va && vma_end > gap_start) {
+            gap_start = vma_end;
+        }
+        if (vma_start > va && vma_start < gap_end) {
+            gap_end = vma_start;
+        }
+        if (va >= vma_start && va < vma_end) {
+            if (vma) parse_vma(line, vma);
             fclose(maps);
-            return 1;
+            return index;
         }
     }
 
     fclose(maps);
-    return 0;
+    if (vma) {
+        vma->start = gap_start;
+        vma->end = gap_end;
+    }
+    return -1;
+}
+
+int is_va_used(uint64_t va, const char* maps_file) {
+    return find_vma(va, maps_file, NULL) >= 0;
 }
 
 void maprange(int pid, uint64_t va1, uint64_t va2) 
@@ -318,23 +987,51 @@ void maprange(int pid, uint64_t va1, uint64_t va2)
     int pagemap = open(pagemap_file, O_RDONLY);
     if (pagemap < 0) 
     {
-        printf("Failed to open pagemap file\n");
+        fprintf(diag(), "Failed to open pagemap file\n");
         return;
     }
 
     char maps_file[64];
     sprintf(maps_file, "/proc/%d/maps", pid);
 
-    for (uint64_t va = va1; va < va2; va += PAGESIZE) 
+    if (output_format != FORMAT_TEXT)
+    {
+        out_begin(CMD_MAPRANGE);
+    }
+    struct vma vma = {0};
+    uint32_t vma_id = PVM_NO_VMA;
+
+    for (uint64_t va = va1; va < va2; va += page_size) 
     {
+        if (output_format != FORMAT_TEXT)
+        {
+            // one maps lookup per VMA or hole rather than per page
+            if (va < vma.start || va >= vma.end)
+            {
+                int64_t index = find_vma(va, maps_file, &vma);
+                vma_id = index < 0 ? PVM_NO_VMA : out_vma(index, &vma);
+            }
+            uint64_t pagemap_entry = 0;
+            if (vma_id != PVM_NO_VMA)
+            {
+                lseek(pagemap, (va >> page_shift) * PAGEMAP_ENTRY_SIZE, SEEK_SET);
+                if (read(pagemap, &pagemap_entry, PAGEMAP_LENGTH) != PAGEMAP_LENGTH)
+                {
+                    continue;
+                }
+            }
+            out_mapping(va >> page_shift, pagemap_entry, vma_id);
+            continue;
+        }
+
         if (!is_va_used(va, maps_file)) 
         {
-            printf("mapping: vpn=0x%012lx unused\n", va >> 12);
+            printf("mapping: vpn=0x%012lx unused\n", va >> page_shift);
             continue;
         }
 
         uint64_t pagemap_entry;
-        uint64_t virt_page_num = va / PAGESIZE;
+        uint64_t virt_page_num = va >> page_shift;
         lseek(pagemap, virt_page_num * PAGEMAP_ENTRY_SIZE, SEEK_SET);
         if (read(pagemap, &pagemap_entry, PAGEMAP_LENGTH) != PAGEMAP_LENGTH) 
         {
@@ -344,14 +1041,18 @@ void maprange(int pid, uint64_t va1, uint64_t va2)
 
         if ((pagemap_entry & (1ULL << 63)) == 0) 
         {
-            printf("mapping: vpn=0x%012lx not-in-memory\n", va >> 12);
+            printf("mapping: vpn=0x%012lx not-in-memory\n", va >> page_shift);
         } 
         else
         {
-            printf("mapping: vpn=0x%012lx pfn=0x%09lx\n", va >> 12, get_entry_frame(pagemap_entry));
+            printf("mapping: vpn=0x%012lx pfn=0x%09lx\n", va >> page_shift, get_entry_frame(pagemap_entry));
         }
     }
 
+    if (output_format != FORMAT_TEXT)
+    {
+        out_end();
+    }
     close(pagemap);
 }
 
@@ -361,7 +1062,7 @@ void mapall(int pid) {
 
     int pagemap = open(pagemap_file, O_RDONLY);
     if (pagemap < 0) {
-        printf("Failed to open pagemap file\n");
+        fprintf(diag(), "Failed to open pagemap file\n");
         return;
     }
 
@@ -370,31 +1071,44 @@ void mapall(int pid) {
 
     FILE* maps_fp = fopen(maps_file, "r");
     if (maps_fp == NULL) {
-        printf("Failed to open maps file\n");
+        fprintf(diag(), "Failed to open maps file\n");
         close(pagemap);
         return;
     }
 
+    if (output_format != FORMAT_TEXT) {
+        out_begin(CMD_MAPALL);
+    }
+
     char line[256];
-    while (fgets(line, sizeof(line), maps_fp) != NULL) {
+    for (int64_t vma_index = 0; fgets(line, sizeof(line), maps_fp) != NULL; vma_index++) {
         uint64_t va_start, va_end;
         char fname[256];  // Added to store the filename
 
         if (sscanf(line, "%lx-%lx %*s %*s %*s %*s %s", &va_start, &va_end, fname) != 3) {
             continue;
         }
+        uint32_t vma_id = PVM_NO_VMA;
+        if (output_format != FORMAT_TEXT) {
+            struct vma vma;
+            parse_vma(line, &vma);
+            vma_id = out_vma(vma_index, &vma);
+        }
 
-        for (uint64_t va = va_start; va < va_end; va += PAGESIZE) {
+        for (uint64_t va = va_start; va < va_end; va += page_size) {
             
             uint64_t pagemap_entry;
-            uint64_t virt_page_num = va / PAGESIZE;
+            uint64_t virt_page_num = va >> page_shift;
             lseek(pagemap, virt_page_num * PAGEMAP_ENTRY_SIZE, SEEK_SET);
             if (read(pagemap, &pagemap_entry, PAGEMAP_LENGTH) != PAGEMAP_LENGTH) {
-                printf("Failed to read pagemap entry for VA 0x%09lx\n", va >> 12);
+                if (output_format == FORMAT_TEXT)
+                    printf("Failed to read pagemap entry for VA 0x%09lx\n", va >> page_shift);
                 continue;
             }
 
-            if ((pagemap_entry & (1ULL << 63)) == 0) {
+            if (output_format != FORMAT_TEXT) {
+                out_mapping(virt_page_num, pagemap_entry, vma_id);
+            } else if ((pagemap_entry & (1ULL << 63)) == 0) {
                 FILE *status_fp;
                 char status_file[64];
                 sprintf(status_file, "/proc/%d/status", pid);
@@ -407,14 +1121,17 @@ void mapall(int pid) {
                     }
                 }
                 fclose(status_fp);
-                printf("mapping: vpn=0x%09lx not-in-memory, swpd=%s, fname=%s\n", va >> 12, swpd, fname);
+                printf("mapping: vpn=0x%09lx not-in-memory, swpd=%s, fname=%s\n", va >> page_shift, swpd, fname);
             } else {
-                printf("mapping: vpn=0x%09lx pfn=0x%09lx, fname=%s\n", va >> 12, get_entry_frame(pagemap_entry), fname);
+                printf("mapping: vpn=0x%09lx pfn=0x%09lx, fname=%s\n", va >> page_shift, get_entry_frame(pagemap_entry), fname);
             }
             
         }
     }
 
+    if (output_format != FORMAT_TEXT) {
+        out_end();
+    }
     fclose(maps_fp);
     close(pagemap);
 }
@@ -425,7 +1142,7 @@ void mapallin(int pid) {
 
     int pagemap = open(pagemap_file, O_RDONLY);
     if (pagemap < 0) {
-        printf("Failed to open pagemap file\n");
+        fprintf(diag(), "Failed to open pagemap file\n");
         return;
     }
 
@@ -434,38 +1151,126 @@ void mapallin(int pid) {
 
     FILE* maps_fp = fopen(maps_file, "r");
     if (maps_fp == NULL) {
-        printf("Failed to open maps file\n");
+        fprintf(diag(), "Failed to open maps file\n");
         close(pagemap);
         return;
     }
 
-    char line[256];
-    while (fgets(line, sizeof(line), maps_fp) != NULL) {
+    if (output_format != FORMAT_TEXT) {
+        out_begin(CMD_MAPALLIN);
+    }
+
+    char line[256];
+    for (int64_t vma_index = 0; fgets(line, sizeof(line), maps_fp) != NULL; vma_index++) {
         uint64_t va_start, va_end;
         if (sscanf(line, "%lx-%lx", &va_start, &va_end) != 2) {
             continue;
         }
+        uint32_t vma_id = PVM_NO_VMA;
+        if (output_format != FORMAT_TEXT) {
+            struct vma vma;
+            parse_vma(line, &vma);
+            vma_id = out_vma(vma_index, &vma);
+        }
 
-        for (uint64_t va = va_start; va < va_end; va += PAGESIZE) {
+        for (uint64_t va = va_start; va < va_end; va += page_size) {
             
             uint64_t pagemap_entry;
-            uint64_t virt_page_num = va / PAGESIZE;
+            uint64_t virt_page_num = va >> page_shift;
             lseek(pagemap, virt_page_num * PAGEMAP_ENTRY_SIZE, SEEK_SET);
             if (read(pagemap, &pagemap_entry, PAGEMAP_LENGTH) != PAGEMAP_LENGTH) {
-                printf("Failed to read pagemap entry for VA 0x%09lx\n", va >> 12);
+                if (output_format == FORMAT_TEXT)
+                    printf("Failed to read pagemap entry for VA 0x%09lx\n", va >> page_shift);
                 continue;
             }
 
             if ((pagemap_entry & (1ULL << 63)) != 0) {
-                printf("mapping: vpn=0x%09lx: pfn=0x%09lx\n", va >> 12, get_entry_frame(pagemap_entry));
+                if (output_format != FORMAT_TEXT)
+                    out_mapping(virt_page_num, pagemap_entry, vma_id);
+                else
+                    printf("mapping: vpn=0x%09lx: pfn=0x%09lx\n", va >> page_shift, get_entry_frame(pagemap_entry));
             }
         }
     }
 
+    if (output_format != FORMAT_TEXT) {
+        out_end();
+    }
     fclose(maps_fp);
     close(pagemap);
 }
 
+// Marks a last-level table as present; its entries are never looked at, so
+// there is no need to allocate it.
+#define LEAF_TABLE ((void*) 1)
+
+// Walks [start, end) through the page table tree and allocates every table
+// that is touched. One step per last-level table is enough, since all pages
+// under the same table share the upper indices. Always inlined so that the
+// dispatch in table_walk() gets a copy with shift and levels folded in.
+static inline __attribute__((always_inline))
+void table_walk_kernel(void **root, uint64_t start, uint64_t end, uint64_t *levels_used,
+                       const int shift, const int levels)
+{
+    const int bits = shift - 3;
+    const uint64_t mask = (1ULL << bits) - 1;
+    const uint64_t span = 1ULL << (shift + bits);   // VA covered by one last-level table
+
+    for (uint64_t addr = start & ~(span - 1); addr < end; addr += span)
+    {
+        void **table = root;
+        for (int i = 1; i < levels; i++)
+        {
+            uint64_t index = (addr >> (shift + bits * (levels - i))) & mask;
+            if (!table[index])
+            {
+                table[index] = (i == levels - 1) ? LEAF_TABLE : calloc(mask + 1, sizeof(void*));
+                levels_used[i]++;
+            }
+            table = table[index];
+        }
+    }
+}
+
+// Specialized variants for what detect_paging_levels() returns: 4K with 4
+// levels (x86-64, arm64 48-bit), 5 levels (x86-64 LA57, arm64 52-bit LPA2) or
+// 3 levels (arm64 39-bit), 16K with 3 levels (arm64 47-bit) or 4 (48/52-bit)
+// and 64K with 2 levels (arm64 42-bit) or 3 (48/52-bit).
+void table_walk(void **root, uint64_t start, uint64_t end, uint64_t *levels_used, int levels)
+{
+    if (page_shift == 12 && levels == 4)
+        table_walk_kernel(root, start, end, levels_used, 12, 4);
+    else if (page_shift == 12 && levels == 5)
+        table_walk_kernel(root, start, end, levels_used, 12, 5);
+    else if (page_shift == 12 && levels == 3)
+        table_walk_kernel(root, start, end, levels_used, 12, 3);
+    else if (page_shift == 14 && levels == 4)
+        table_walk_kernel(root, start, end, levels_used, 14, 4);
+    else if (page_shift == 14 && levels == 3)
+        table_walk_kernel(root, start, end, levels_used, 14, 3);
+    else if (page_shift == 16 && levels == 3)
+        table_walk_kernel(root, start, end, levels_used, 16, 3);
+    else if (page_shift == 16 && levels == 2)
+        table_walk_kernel(root, start, end, levels_used, 16, 2);
+    else
+        table_walk_kernel(root, start, end, levels_used, page_shift, levels);
+}
+
+void free_page_table(void **table, int level, int levels)
+{
+    if (level < levels - 2)
+    {
+        for (uint64_t i = 0; i < entries_per_page; i++)
+        {
+            if (table[i])
+            {
+                free_page_table(table[i], level + 1, levels);
+            }
+        }
+    }
+    free(table);
+}
+
 void alltablesize(int pid) {
     char path[64];
     sprintf(path, "/proc/%d/maps", pid);
@@ -476,62 +1281,1011 @@ void alltablesize(int pid) {
         perror("Could not open file");
         return;
     }
+    int levels = detect_paging_levels(pid);
 
-    char ****page_table = calloc(ENTRY_PER_PAGE, sizeof(char***));
-    uint64_t paging_levels[4] = {1, 0, 0, 0};
+    void **page_table = calloc(entries_per_page, sizeof(void*));
+    uint64_t paging_levels[MAX_PAGING_LEVELS] = {1, 0, 0, 0, 0};
 
     char line[256];
     while (fgets(line, sizeof(line), file)) 
     {
         uint64_t start, end;
-        sscanf(line, "%lx-%lx", &start, &end);
-        for(uint64_t addr=start; addr<end; addr+=PAGESIZE) 
+        if (sscanf(line, "%lx-%lx", &start, &end) != 2)
         {
-            uint64_t indices[4] = 
+            continue;
+        }
+        table_walk(page_table, start, end, paging_levels, levels);
+    }
+    fclose(file);
+    // Free the dynamically allocated memory
+    free_page_table(page_table, 0, levels);
+
+    uint64_t frames = 0;
+    for (int i = 0; i < levels; i++)
+    {
+        frames += paging_levels[i];
+    }
+    uint64_t pageTableSizeKB = frames * PAGEMAP_ENTRY_SIZE * entries_per_page / 1024;
+    if (output_format != FORMAT_TEXT)
+    {
+        char name[32];
+        out_begin(CMD_ALLTABLESIZE);
+        out_stat("levels", levels);
+        out_stat("size_kb", pageTableSizeKB);
+        out_stat("frames", frames);
+        for (int i = 0; i < levels; i++)
+        {
+            sprintf(name, "level%d", i + 1);
+            out_stat(name, paging_levels[i]);
+        }
+        out_end();
+        return;
+    }
+
+    printf("(pid=%d) total memory occupied by %d-level page table: %lu KB (%lu frames)\n",
+           pid, levels, pageTableSizeKB, frames);
+
+    printf("(pid=%d) number of page tables used:", pid);
+    for (int i = 0; i < levels; i++)
+    {
+        printf("%s level%d=%lu", i ? "," : "", i + 1, paging_levels[i]);
+    }
+    printf("\n");
+}
+
+struct wss_page {
+    uint64_t pfn;
+    uint32_t vma;
+};
+
+int compare_wss_pages(const void* a, const void* b)
+{
+    uint64_t x = ((const struct wss_page*) a)->pfn, y = ((const struct wss_page*) b)->pfn;
+    return (x > y) - (x < y);
+}
+
+// Sets (mark) or tests the idle bit of every page in pages, which must be
+// sorted by pfn. Pages are grouped into word-aligned batches of the bitmap so
+// that each batch costs one pwrite or pread; when testing, idle[v] counts the
+// pages of VMA v that were not accessed.
+int idle_bitmap_batches(int bitmap, struct wss_page* pages, uint64_t n, bool mark, uint64_t* idle)
+{
+    uint64_t words[IDLE_BATCH_WORDS];
+
+    for (uint64_t i = 0, j; i < n; i = j)
+    {
+        uint64_t first = pages[i].pfn / 64, last = first;
+        for (j = i; j < n; j++)
+        {
+            uint64_t word = pages[j].pfn / 64;
+            if (word - first >= IDLE_BATCH_WORDS || word > last + IDLE_GAP_WORDS)
             {
-                (addr >> 39) & 0x1FF,
-                (addr >> 30) & 0x1FF,
-                (addr >> 21) & 0x1FF,
-                (addr >> 12) & 0x1FF
-            };
-            char ****pt1 = page_table;
-            for(int i=0; i<4; i++) 
+                break;
+            }
+            last = word;
+        }
+
+        size_t length = (last - first + 1) * sizeof(uint64_t);
+        off_t offset = first * sizeof(uint64_t);
+        if (mark)
+        {
+            memset(words, 0, length);
+            for (uint64_t k = i; k < j; k++)
+            {
+                words[pages[k].pfn / 64 - first] |= 1ULL << (pages[k].pfn % 64);
+            }
+            if (pwrite(bitmap, words, length, offset) != (ssize_t) length)
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            if (pread(bitmap, words, length, offset) != (ssize_t) length)
+            {
+                return -1;
+            }
+            for (uint64_t k = i; k < j; k++)
+            {
+                idle[pages[k].vma] += (words[pages[k].pfn / 64 - first] >> (pages[k].pfn % 64)) & 1;
+            }
+        }
+    }
+    return 0;
+}
+
+void wss(int pid, int interval)
+{
+    struct pagemap_iter it;
+    int status = pagemap_iter_open(&it, pid);
+    if (status < 0)
+    {
+        report_iter_error(status);
+        return;
+    }
+    struct vma* vmas = it.vmas;
+    int vma_count = it.vma_count;
+
+    // Gather the present frames of every VMA
+    uint64_t* resident = calloc(vma_count + 1, sizeof(uint64_t));
+    uint64_t* idle = calloc(vma_count + 1, sizeof(uint64_t));
+    uint64_t n = 0, capacity = 4096;
+    struct wss_page* pages = malloc(capacity * sizeof(struct wss_page));
+
+    while (pagemap_iter_next(&it))
+    {
+        for (uint64_t i = 0; i < it.n; i++)
+        {
+            uint64_t pfn = get_entry_frame(it.entries[i]);
+            if (!(it.entries[i] >> 63) || pfn == 0)
+            {
+                continue;
+            }
+            if (n == capacity)
+            {
+                capacity *= 2;
+                pages = realloc(pages, capacity * sizeof(struct wss_page));
+            }
+            pages[n++] = (struct wss_page) { pfn, it.v };
+            resident[it.v]++;
+        }
+    }
+    if (it.hidden)
+    {
+        report_iter_error(ITER_HIDDEN);
+        free(pages);
+        free(resident);
+        free(idle);
+        pagemap_iter_close(&it);
+        return;
+    }
+
+    qsort(pages, n, sizeof(struct wss_page), compare_wss_pages);
+
+    int bitmap = open(PAGE_IDLE_PATH, O_RDWR);
+    if (bitmap < 0)
+    {
+        perror("Failed to open page_idle bitmap");
+    }
+    else if (idle_bitmap_batches(bitmap, pages, n, true, NULL) < 0)
+    {
+        perror("Failed to mark pages idle");
+    }
+    else
+    {
+        sleep(interval);
+        if (idle_bitmap_batches(bitmap, pages, n, false, idle) < 0)
+        {
+            perror("Failed to read page_idle bitmap");
+        }
+        else
+        {
+            uint64_t total_accessed = 0, total_idle = 0;
+            for (int v = 0; v < vma_count; v++)
+            {
+                total_accessed += resident[v] - idle[v];
+                total_idle += idle[v];
+            }
+
+            if (output_format != FORMAT_TEXT)
             {
-                if(!*pt1) 
+                out_begin(CMD_WSS);
+                for (int v = 0; v < vma_count; v++)
                 {
-                    *pt1 = calloc(ENTRY_PER_PAGE, sizeof(void*));
-                    if(i)
-                    paging_levels[i]++;
+                    if (!resident[v])
+                    {
+                        continue;
+                    }
+                    uint32_t id = out_vma(v, &vmas[v]);
+                    out_vma_stat(id, "accessed_kb", (resident[v] - idle[v]) * page_size / 1024);
+                    out_vma_stat(id, "idle_kb", idle[v] * page_size / 1024);
+                }
+                out_stat("accessed_kb", total_accessed * page_size / 1024);
+                out_stat("idle_kb", total_idle * page_size / 1024);
+                out_end();
+            }
+            else
+            {
+                printf("(pid=%d) wss: interval=%d s, accessed=%lu KB, idle=%lu KB\n",
+                       pid, interval, total_accessed * page_size / 1024, total_idle * page_size / 1024);
+                for (int v = 0; v < vma_count; v++)
+                {
+                    if (resident[v])
+                    {
+                        printf("vma=0x%012lx-0x%012lx: accessed=%lu KB, idle=%lu KB, fname=%s\n",
+                               vmas[v].start, vmas[v].end, (resident[v] - idle[v]) * page_size / 1024,
+                               idle[v] * page_size / 1024, vmas[v].name);
+                    }
                 }
-                pt1 = (char****) &(*pt1)[indices[i]];
-                
             }
         }
     }
-    fclose(file);
-    // Free the dynamically allocated memory
-    for (uint64_t i = 0; i < ENTRY_PER_PAGE; i++) {
-        if (page_table[i]) {
-            for (uint64_t j = 0; j < ENTRY_PER_PAGE; j++) {
-                if (page_table[i][j]) {
-                    for (uint64_t k = 0; k < ENTRY_PER_PAGE; k++) {
-                        if (page_table[i][j][k]) {
-                            free(page_table[i][j][k]);
-                        }
-                    }
-                    free(page_table[i][j]);
+    if (bitmap >= 0)
+    {
+        close(bitmap);
+    }
+
+    free(pages);
+    free(resident);
+    free(idle);
+    pagemap_iter_close(&it);
+}
+
+#define RUN_HISTOGRAM_BUCKETS 40
+
+struct contiguity {
+    uint64_t resident;                      // pages
+    uint64_t runs;
+    uint64_t alignable;                     // pages in runs holding an aligned huge page
+    uint64_t run_count[RUN_HISTOGRAM_BUCKETS];
+    uint64_t run_pages[RUN_HISTOGRAM_BUCKETS];
+    int max_order;                          // -1 when nothing is resident
+};
+
+// Largest order of a naturally aligned block inside the frames [pfn, pfn + length)
+int max_block_order(uint64_t pfn, uint64_t length)
+{
+    int order = 63 - __builtin_clzll(length);
+    while (order > 0)
+    {
+        uint64_t size = 1ULL << order;
+        uint64_t start = (pfn + size - 1) & ~(size - 1);
+        if (start + size <= pfn + length)
+        {
+            break;
+        }
+        order--;
+    }
+    return order;
+}
+
+// Accounts one physically contiguous run of virtually consecutive pages
+void add_run(struct contiguity* c, uint64_t vpn, uint64_t pfn, uint64_t length)
+{
+    int bucket = 63 - __builtin_clzll(length);
+    if (bucket >= RUN_HISTOGRAM_BUCKETS)
+    {
+        bucket = RUN_HISTOGRAM_BUCKETS - 1;
+    }
+    c->run_count[bucket]++;
+    c->run_pages[bucket] += length;
+    c->resident += length;
+    c->runs++;
+
+    int order = max_block_order(pfn, length);
+    if (order > c->max_order)
+    {
+        c->max_order = order;
+    }
+
+    // A huge page mapping needs a block aligned in both address spaces; as
+    // vpn - pfn is constant along the run it has to be huge page aligned.
+    uint64_t huge = (2ULL << 20) >> page_shift;
+    if (((vpn - pfn) & (huge - 1)) == 0 && ((vpn + huge - 1) & ~(huge - 1)) + huge <= vpn + length)
+    {
+        c->alignable += length;
+    }
+}
+
+void merge_contiguity(struct contiguity* total, const struct contiguity* c)
+{
+    total->resident += c->resident;
+    total->runs += c->runs;
+    total->alignable += c->alignable;
+    for (int i = 0; i < RUN_HISTOGRAM_BUCKETS; i++)
+    {
+        total->run_count[i] += c->run_count[i];
+        total->run_pages[i] += c->run_pages[i];
+    }
+    if (c->max_order > total->max_order)
+    {
+        total->max_order = c->max_order;
+    }
+}
+
+void contiguity(int pid)
+{
+    struct pagemap_iter it;
+    int status = pagemap_iter_open(&it, pid);
+    if (status < 0)
+    {
+        report_iter_error(status);
+        return;
+    }
+    struct vma* vmas = it.vmas;
+    int vma_count = it.vma_count;
+
+    struct contiguity* per_vma = calloc(vma_count, sizeof(struct contiguity));
+    struct contiguity total = { .max_order = -1 };
+    for (int v = 0; v < vma_count; v++)
+    {
+        per_vma[v].max_order = -1;
+    }
+
+    // Pages [run_vpn, run_vpn + run_length) of VMA run_vma map to frames
+    // from run_pfn on; runs end at VMA boundaries
+    int run_vma = -1;
+    uint64_t run_vpn = 0, run_pfn = 0, run_length = 0;
+    while (pagemap_iter_next(&it))
+    {
+        for (uint64_t i = 0; i < it.n; i++)
+        {
+            uint64_t pfn = get_entry_frame(it.entries[i]);
+            bool present = (it.entries[i] >> 63) && pfn;
+            if (present && run_length && it.v == run_vma && pfn == run_pfn + run_length)
+            {
+                run_length++;
+                continue;
+            }
+            if (run_length)
+            {
+                add_run(&per_vma[run_vma], run_vpn, run_pfn, run_length);
+            }
+            run_vma = it.v;
+            run_vpn = it.vpn + i;
+            run_pfn = pfn;
+            run_length = present;
+        }
+    }
+    if (it.hidden)
+    {
+        report_iter_error(ITER_HIDDEN);
+        free(per_vma);
+        pagemap_iter_close(&it);
+        return;
+    }
+    if (run_length)
+    {
+        add_run(&per_vma[run_vma], run_vpn, run_pfn, run_length);
+    }
+    for (int v = 0; v < vma_count; v++)
+    {
+        merge_contiguity(&total, &per_vma[v]);
+    }
+
+    uint64_t kb_per_page = page_size / 1024;
+    if (output_format != FORMAT_TEXT)
+    {
+        char name[64];
+        out_begin(CMD_CONTIGUITY);
+        for (int v = 0; v < vma_count; v++)
+        {
+            if (!per_vma[v].resident)
+            {
+                continue;
+            }
+            uint32_t id = out_vma(v, &vmas[v]);
+            out_vma_stat(id, "resident_kb", per_vma[v].resident * kb_per_page);
+            out_vma_stat(id, "runs", per_vma[v].runs);
+            out_vma_stat(id, "max_order", per_vma[v].max_order);
+        }
+        out_stat("resident_kb", total.resident * kb_per_page);
+        out_stat("runs", total.runs);
+        out_stat("alignable_2m_kb", total.alignable * kb_per_page);
+        for (int i = 0; i < RUN_HISTOGRAM_BUCKETS; i++)
+        {
+            if (total.run_count[i])
+            {
+                sprintf(name, "runs_%lu", 1UL << i);
+                out_stat(name, total.run_count[i]);
+                sprintf(name, "runs_%lu_kb", 1UL << i);
+                out_stat(name, total.run_pages[i] * kb_per_page);
+            }
+        }
+        out_end();
+    }
+    else
+    {
+        printf("(pid=%d) contiguity: resident=%lu KB, runs=%lu, 2MiB-alignable=%lu KB (%.1f%%), max order=%d\n",
+               pid, total.resident * kb_per_page, total.runs, total.alignable * kb_per_page,
+               total.resident ? 100.0 * total.alignable / total.resident : 0.0, total.max_order);
+        for (int i = 0; i < RUN_HISTOGRAM_BUCKETS; i++)
+        {
+            if (total.run_count[i])
+            {
+                printf("run length %lu-%lu pages: runs=%lu, memory=%lu KB\n",
+                       1UL << i, (2UL << i) - 1, total.run_count[i], total.run_pages[i] * kb_per_page);
+            }
+        }
+        for (int v = 0; v < vma_count; v++)
+        {
+            if (per_vma[v].resident)
+            {
+                printf("vma=0x%012lx-0x%012lx: resident=%lu KB, runs=%lu, max order=%d, fname=%s\n",
+                       vmas[v].start, vmas[v].end, per_vma[v].resident * kb_per_page,
+                       per_vma[v].runs, per_vma[v].max_order, vmas[v].name);
+            }
+        }
+    }
+
+    free(per_vma);
+    pagemap_iter_close(&it);
+}
+
+#define SWAP_TYPES 32       // MAX_SWAPFILES
+#define WORST_VMAS 5
+
+struct swap_slot {
+    uint64_t offset;
+    uint32_t type;
+};
+
+struct vma_swap {
+    int vma;
+    uint64_t swapped;       // pages
+    uint64_t runs;          // runs of consecutive slots in virtual order
+};
+
+int compare_swap_slots(const void* a, const void* b)
+{
+    const struct swap_slot* x = a;
+    const struct swap_slot* y = b;
+    if (x->type != y->type)
+    {
+        return x->type < y->type ? -1 : 1;
+    }
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+int compare_vma_swap(const void* a, const void* b)
+{
+    uint64_t x = ((const struct vma_swap*) a)->runs, y = ((const struct vma_swap*) b)->runs;
+    return (x < y) - (x > y);
+}
+
+void swapmap(int pid)
+{
+    struct pagemap_iter it;
+    int status = pagemap_iter_open(&it, pid);
+    if (status < 0)
+    {
+        report_iter_error(status);
+        return;
+    }
+    struct vma* vmas = it.vmas;
+    int vma_count = it.vma_count;
+
+    struct vma_swap* per_vma = calloc(vma_count, sizeof(struct vma_swap));
+    for (int v = 0; v < vma_count; v++)
+    {
+        per_vma[v].vma = v;
+    }
+    uint64_t n = 0, capacity = 4096;
+    struct swap_slot* slots = malloc(capacity * sizeof(struct swap_slot));
+
+    // previous_vma is the VMA of the page before, when that page was swapped
+    int previous_vma = -1;
+    uint64_t previous_entry = 0;
+    while (pagemap_iter_next(&it))
+    {
+        for (uint64_t i = 0; i < it.n; i++)
+        {
+            uint64_t entry = it.entries[i];
+            if ((entry >> 63) || !((entry >> 62) & 1))
+            {
+                previous_vma = -1;
+                continue;
+            }
+
+            struct vma_swap* vs = &per_vma[it.v];
+            if (previous_vma != it.v || get_swap_type(entry) != get_swap_type(previous_entry) ||
+                get_swap_offset(entry) != get_swap_offset(previous_entry) + 1)
+            {
+                vs->runs++;
+            }
+            vs->swapped++;
+            previous_vma = it.v;
+            previous_entry = entry;
+
+            if (n == capacity)
+            {
+                capacity *= 2;
+                slots = realloc(slots, capacity * sizeof(struct swap_slot));
+            }
+            slots[n++] = (struct swap_slot) { get_swap_offset(entry), get_swap_type(entry) };
+        }
+    }
+    if (it.hidden)
+    {
+        report_iter_error(ITER_HIDDEN);
+        free(slots);
+        free(per_vma);
+        pagemap_iter_close(&it);
+        return;
+    }
+
+    // Slot runs per swap device, independent of which page owns the slot
+    uint64_t swapped[SWAP_TYPES] = {0};
+    uint64_t runs[SWAP_TYPES] = {0};
+    uint64_t (*run_count)[RUN_HISTOGRAM_BUCKETS] = calloc(SWAP_TYPES, sizeof(*run_count));
+    uint64_t (*run_slots)[RUN_HISTOGRAM_BUCKETS] = calloc(SWAP_TYPES, sizeof(*run_slots));
+
+    qsort(slots, n, sizeof(struct swap_slot), compare_swap_slots);
+    for (uint64_t i = 0, j; i < n; i = j)
+    {
+        uint32_t type = slots[i].type;
+        for (j = i + 1; j < n && slots[j].type == type && slots[j].offset <= slots[j - 1].offset + 1; j++)
+            ;
+        // a slot shared by several pages shows up more than once; the run
+        // length counts distinct slots
+        uint64_t length = slots[j - 1].offset - slots[i].offset + 1;
+        int bucket = 63 - __builtin_clzll(length);
+        if (bucket >= RUN_HISTOGRAM_BUCKETS)
+        {
+            bucket = RUN_HISTOGRAM_BUCKETS - 1;
+        }
+        swapped[type] += j - i;
+        runs[type]++;
+        run_count[type][bucket]++;
+        run_slots[type][bucket] += length;
+    }
+    free(slots);
+
+    qsort(per_vma, vma_count, sizeof(struct vma_swap), compare_vma_swap);
+    int worst = vma_count < WORST_VMAS ? vma_count : WORST_VMAS;
+    while (worst > 0 && per_vma[worst - 1].runs == 0)
+    {
+        worst--;
+    }
+
+    uint64_t kb_per_page = page_size / 1024;
+    if (output_format != FORMAT_TEXT)
+    {
+        char name[64];
+        out_begin(CMD_SWAPMAP);
+        for (int w = 0; w < worst; w++)
+        {
+            struct vma* vma = &vmas[per_vma[w].vma];
+            uint32_t id = out_vma(per_vma[w].vma, vma);
+            out_vma_stat(id, "swapped_kb", per_vma[w].swapped * kb_per_page);
+            out_vma_stat(id, "runs", per_vma[w].runs);
+        }
+        out_stat("swapped_kb", n * kb_per_page);
+        for (int t = 0; t < SWAP_TYPES; t++)
+        {
+            if (!runs[t])
+            {
+                continue;
+            }
+            sprintf(name, "type%d_swapped_kb", t);
+            out_stat(name, swapped[t] * kb_per_page);
+            sprintf(name, "type%d_runs", t);
+            out_stat(name, runs[t]);
+            for (int i = 0; i < RUN_HISTOGRAM_BUCKETS; i++)
+            {
+                if (run_count[t][i])
+                {
+                    sprintf(name, "type%d_runs_%lu", t, 1UL << i);
+                    out_stat(name, run_count[t][i]);
+                    sprintf(name, "type%d_runs_%lu_kb", t, 1UL << i);
+                    out_stat(name, run_slots[t][i] * kb_per_page);
                 }
             }
-            free(page_table[i]);
+        }
+        out_end();
+    }
+    else
+    {
+        printf("(pid=%d) swapmap: swapped=%lu KB\n", pid, n * kb_per_page);
+        for (int t = 0; t < SWAP_TYPES; t++)
+        {
+            if (!runs[t])
+            {
+                continue;
+            }
+            printf("swap type 0x%x: swapped=%lu KB, runs=%lu\n", t, swapped[t] * kb_per_page, runs[t]);
+            for (int i = 0; i < RUN_HISTOGRAM_BUCKETS; i++)
+            {
+                if (run_count[t][i])
+                {
+                    printf("run length %lu-%lu slots: runs=%lu, swapped=%lu KB\n",
+                           1UL << i, (2UL << i) - 1, run_count[t][i], run_slots[t][i] * kb_per_page);
+                }
+            }
+        }
+        for (int w = 0; w < worst; w++)
+        {
+            struct vma* vma = &vmas[per_vma[w].vma];
+            printf("vma=0x%012lx-0x%012lx: swapped=%lu KB, runs=%lu, fname=%s\n",
+                   vma->start, vma->end, per_vma[w].swapped * kb_per_page, per_vma[w].runs, vma->name);
         }
     }
-    free(page_table);
-    uint64_t pageTableSizeKB = (paging_levels[0] + paging_levels[1] + paging_levels[2] + paging_levels[3]) * PAGEMAP_ENTRY_SIZE * ENTRY_PER_PAGE / 1024;
-    printf("(pid=%d) total memory occupied by 4-level page table: %lu KB (%lu frames)\n",
-           pid, pageTableSizeKB, paging_levels[0] + paging_levels[1] + paging_levels[2] + paging_levels[3]);
 
-    printf("(pid=%d) number of page tables used: level1=%lu, level2=%lu, level3=%lu, level4=%lu\n",
-           pid, paging_levels[0], paging_levels[1], paging_levels[2], paging_levels[3]);
+    free(run_count);
+    free(run_slots);
+    free(per_vma);
+    pagemap_iter_close(&it);
+}
+
+struct file_range {
+    uint64_t first;         // file page index
+    uint64_t end;
+};
+
+struct mapped_file {
+    unsigned int major;
+    unsigned int minor;
+    uint64_t inode;
+    char name[256];
+    struct file_range* ranges;
+    uint64_t range_count;
+    uint64_t range_capacity;
+    uint64_t mapped;        // pages, filled in by file_mapped_pages()
+    uint64_t resident;
+    uint64_t shared;
+};
+
+struct file_page {
+    uint64_t pfn;
+    uint32_t file;
+    uint32_t mappings;      // by the one process that maps the frame most
+};
+
+// Files are looked up by device and inode through an open-addressing table
+// of indices into files.
+struct file_table {
+    struct mapped_file* files;
+    uint32_t count;
+    uint32_t capacity;
+    int64_t* slots;
+    uint32_t slot_count;    // power of two, at least twice count
+};
+
+uint32_t file_slot(struct file_table* t, unsigned int major, unsigned int minor, uint64_t inode)
+{
+    uint64_t hash = (inode ^ ((uint64_t) major << 52) ^ ((uint64_t) minor << 32)) * 0x9E3779B97F4A7C15ULL;
+    uint32_t slot = hash >> 32 & (t->slot_count - 1);
+    while (t->slots[slot] >= 0)
+    {
+        struct mapped_file* f = &t->files[t->slots[slot]];
+        if (f->inode == inode && f->major == major && f->minor == minor)
+        {
+            break;
+        }
+        slot = (slot + 1) & (t->slot_count - 1);
+    }
+    return slot;
+}
+
+uint32_t lookup_file(struct file_table* t, const struct vma* vma)
+{
+    if (2 * (t->count + 1) > t->slot_count)
+    {
+        t->slot_count = t->slot_count ? t->slot_count * 2 : 1024;
+        free(t->slots);
+        t->slots = malloc(t->slot_count * sizeof(int64_t));
+        memset(t->slots, -1, t->slot_count * sizeof(int64_t));
+        for (uint32_t i = 0; i < t->count; i++)
+        {
+            t->slots[file_slot(t, t->files[i].major, t->files[i].minor, t->files[i].inode)] = i;
+        }
+    }
+
+    uint32_t slot = file_slot(t, vma->major, vma->minor, vma->inode);
+    if (t->slots[slot] >= 0)
+    {
+        return t->slots[slot];
+    }
+
+    if (t->count == t->capacity)
+    {
+        t->capacity = t->capacity ? t->capacity * 2 : 256;
+        t->files = realloc(t->files, t->capacity * sizeof(struct mapped_file));
+    }
+    struct mapped_file* f = &t->files[t->count];
+    memset(f, 0, sizeof(*f));
+    f->major = vma->major;
+    f->minor = vma->minor;
+    f->inode = vma->inode;
+    strcpy(f->name, vma->name);
+    t->slots[slot] = t->count;
+    return t->count++;
+}
+
+int compare_file_ranges(const void* a, const void* b)
+{
+    uint64_t x = ((const struct file_range*) a)->first, y = ((const struct file_range*) b)->first;
+    return (x > y) - (x < y);
+}
+
+int compare_file_pages(const void* a, const void* b)
+{
+    uint64_t x = ((const struct file_page*) a)->pfn, y = ((const struct file_page*) b)->pfn;
+    return (x > y) - (x < y);
+}
+
+int compare_files_resident(const void* a, const void* b)
+{
+    uint64_t x = ((const struct mapped_file*) a)->resident, y = ((const struct mapped_file*) b)->resident;
+    return (x < y) - (x > y);
+}
+
+// Size of the union of the file ranges mapped by any VMA, in pages
+uint64_t file_mapped_pages(struct mapped_file* f)
+{
+    qsort(f->ranges, f->range_count, sizeof(struct file_range), compare_file_ranges);
+
+    uint64_t pages = 0, covered = 0;
+    for (uint64_t i = 0; i < f->range_count; i++)
+    {
+        uint64_t first = f->ranges[i].first > covered ? f->ranges[i].first : covered;
+        if (f->ranges[i].end > first)
+        {
+            pages += f->ranges[i].end - first;
+            covered = f->ranges[i].end;
+        }
+    }
+    return pages;
+}
+
+void free_file_table(struct file_table* t)
+{
+    for (uint32_t i = 0; i < t->count; i++)
+    {
+        free(t->files[i].ranges);
+    }
+    free(t->files);
+    free(t->slots);
+}
+
+bool is_file_vma(const struct vma* vma)
+{
+    return vma->inode != 0;
+}
+
+// Adds the file-backed VMAs of pid to the table and appends their resident
+// page cache frames to pages. Returns 0 or one of the ITER_ errors.
+int collect_file_pages(int pid, struct file_table* t, struct file_page** pages, uint64_t* n, uint64_t* capacity)
+{
+    struct pagemap_iter it;
+    int status = pagemap_iter_open(&it, pid);
+    if (status < 0)
+    {
+        return status;
+    }
+    it.want = is_file_vma;
+
+    int current = -1;
+    uint32_t file = 0;
+    while (pagemap_iter_next(&it))
+    {
+        if (it.v != current)
+        {
+            // first batch of a VMA: record the file range it maps
+            struct vma* vma = &it.vmas[it.v];
+            current = it.v;
+            file = lookup_file(t, vma);
+            struct mapped_file* f = &t->files[file];
+            if (f->range_count == f->range_capacity)
+            {
+                f->range_capacity = f->range_capacity ? f->range_capacity * 2 : 8;
+                f->ranges = realloc(f->ranges, f->range_capacity * sizeof(struct file_range));
+            }
+            uint64_t first = vma->offset >> page_shift;
+            f->ranges[f->range_count++] = (struct file_range) {
+                first, first + ((vma->end - vma->start) >> page_shift)
+            };
+        }
+
+        for (uint64_t i = 0; i < it.n; i++)
+        {
+            // private copies of file pages are anonymous; bit 61 tells them apart
+            uint64_t pfn = get_entry_frame(it.entries[i]);
+            if (!(it.entries[i] >> 63) || !((it.entries[i] >> 61) & 1) || pfn == 0)
+            {
+                continue;
+            }
+            if (*n == *capacity)
+            {
+                *capacity *= 2;
+                *pages = realloc(*pages, *capacity * sizeof(struct file_page));
+            }
+            (*pages)[(*n)++] = (struct file_page) { pfn, file, 1 };
+        }
+    }
+
+    status = it.hidden ? ITER_HIDDEN : 0;
+    pagemap_iter_close(&it);
+    return status;
+}
+
+// Sorts pages[first, n) by pfn and folds entries of the same frame into one;
+// returns the new n. Entries of one process are separate mappings and add
+// up, while across processes the largest per-process count is kept, so that
+// a frame is shared with other processes exactly when kpagecount exceeds it.
+uint64_t fold_file_pages(struct file_page* pages, uint64_t first, uint64_t n, bool same_process)
+{
+    qsort(pages + first, n - first, sizeof(struct file_page), compare_file_pages);
+
+    uint64_t out = first;
+    for (uint64_t i = first; i < n; i++)
+    {
+        if (out > first && pages[out - 1].pfn == pages[i].pfn)
+        {
+            struct file_page* p = &pages[out - 1];
+            if (same_process)
+                p->mappings += pages[i].mappings;
+            else if (pages[i].mappings > p->mappings)
+                p->mappings = pages[i].mappings;
+            continue;
+        }
+        pages[out++] = pages[i];
+    }
+    return out;
+}
+
+// Charges every frame in pages (folded, sorted by pfn) to its file, reading
+// kpagecount in batches of nearby frames to find those other processes map.
+// The mappings pvm itself holds (self, folded likewise) are not counted as
+// other processes.
+void account_file_pages(struct file_table* t, struct file_page* pages, uint64_t n,
+                        const struct file_page* self, uint64_t self_n)
+{
+    int kpagecount = open(KPAGECOUNT_PATH, O_RDONLY);
+    if (kpagecount < 0)
+    {
+        perror("Failed to open kpagecount file");
+    }
+
+    uint64_t counts[KPAGECOUNT_BATCH];
+    uint64_t s = 0;
+    for (uint64_t i = 0, j; i < n; i = j)
+    {
+        uint64_t first = pages[i].pfn, last = first;
+        for (j = i; j < n && pages[j].pfn - first < KPAGECOUNT_BATCH; j++)
+        {
+            last = pages[j].pfn;
+        }
+
+        size_t length = (last - first + 1) * sizeof(uint64_t);
+        if (kpagecount < 0 || pread(kpagecount, counts, length, first * sizeof(uint64_t)) != (ssize_t) length)
+        {
+            memset(counts, 0, length);
+        }
+        for (uint64_t k = i; k < j; k++)
+        {
+            uint64_t count = counts[pages[k].pfn - first];
+            while (s < self_n && self[s].pfn < pages[k].pfn)
+            {
+                s++;
+            }
+            if (s < self_n && self[s].pfn == pages[k].pfn)
+            {
+                count = count > self[s].mappings ? count - self[s].mappings : 0;
+            }
+
+            struct mapped_file* f = &t->files[pages[k].file];
+            f->resident++;
+            f->shared += count > pages[k].mappings;
+        }
+    }
+
+    if (kpagecount >= 0)
+    {
+        close(kpagecount);
+    }
+}
+
+void fileres(const char* target)
+{
+    struct file_table table = {0};
+    uint64_t n = 0, capacity = 4096;
+    struct file_page* pages = malloc(capacity * sizeof(struct file_page));
+
+    bool all = !strcmp(target, "all");
+    int pid = all ? -1 : atoi(target);
+    int status = 0;
+    if (all)
+    {
+        DIR* proc = opendir("/proc");
+        if (proc == NULL)
+        {
+            perror("Could not open /proc");
+            free(pages);
+            return;
+        }
+        // Fold each process right away and the whole list whenever it has
+        // doubled, so memory follows the distinct frames rather than every
+        // process's mappings of the same files.
+        uint64_t folded = 0;
+        struct dirent* entry;
+        while ((entry = readdir(proc)) != NULL && status != ITER_HIDDEN)
+        {
+            if (isdigit((unsigned char) entry->d_name[0]) && atoi(entry->d_name) != getpid())
+            {
+                uint64_t first = n;
+                // processes that exit or deny access are left out
+                status = collect_file_pages(atoi(entry->d_name), &table, &pages, &n, &capacity);
+                n = fold_file_pages(pages, first, n, true);
+                if (n > 2 * folded)
+                {
+                    n = fold_file_pages(pages, 0, n, false);
+                    folded = n;
+                }
+            }
+        }
+        closedir(proc);
+    }
+    else
+    {
+        status = collect_file_pages(pid, &table, &pages, &n, &capacity);
+        n = fold_file_pages(pages, 0, n, true);
+    }
+
+    if (status == ITER_HIDDEN || (!all && status < 0))
+    {
+        report_iter_error(status);
+        free_file_table(&table);
+        free(pages);
+        return;
+    }
+
+    // pvm maps its own binary, libc and ld.so, which raises kpagecount of
+    // the frames it shares with the processes being measured
+    struct file_table self_table = {0};
+    uint64_t self_n = 0, self_capacity = 256;
+    struct file_page* self = malloc(self_capacity * sizeof(struct file_page));
+    if (pid != getpid())
+    {
+        collect_file_pages(getpid(), &self_table, &self, &self_n, &self_capacity);
+        self_n = fold_file_pages(self, 0, self_n, true);
+    }
+    free_file_table(&self_table);
+
+    n = fold_file_pages(pages, 0, n, false);
+    account_file_pages(&table, pages, n, self, self_n);
+    free(pages);
+    free(self);
+
+    uint64_t total_mapped = 0, total_resident = 0, total_shared = 0;
+    for (uint32_t i = 0; i < table.count; i++)
+    {
+        struct mapped_file* f = &table.files[i];
+        f->mapped = file_mapped_pages(f);
+        total_mapped += f->mapped;
+        total_resident += f->resident;
+        total_shared += f->shared;
+        free(f->ranges);
+    }
+    qsort(table.files, table.count, sizeof(struct mapped_file), compare_files_resident);
+
+    uint64_t kb_per_page = page_size / 1024;
+    if (output_format != FORMAT_TEXT)
+    {
+        out_begin(CMD_FILERES);
+        for (uint32_t i = 0; i < table.count; i++)
+        {
+            struct mapped_file* f = &table.files[i];
+            struct vma file = { 0, 0, 0, f->major, f->minor, f->inode, "" };
+            strcpy(file.name, f->name);
+            uint32_t id = out_vma(i, &file);
+            out_vma_stat(id, "mapped_kb", f->mapped * kb_per_page);
+            out_vma_stat(id, "resident_kb", f->resident * kb_per_page);
+            out_vma_stat(id, "shared_kb", f->shared * kb_per_page);
+        }
+        out_stat("mapped_kb", total_mapped * kb_per_page);
+        out_stat("resident_kb", total_resident * kb_per_page);
+        out_stat("shared_kb", total_shared * kb_per_page);
+        out_end();
+    }
+    else
+    {
+        if (all)
+            printf("(all) ");
+        else
+            printf("(pid=%d) ", pid);
+        printf("fileres: files=%u, mapped=%lu KB, resident=%lu KB, shared=%lu KB\n",
+               table.count, total_mapped * kb_per_page, total_resident * kb_per_page, total_shared * kb_per_page);
+        for (uint32_t i = 0; i < table.count; i++)
+        {
+            struct mapped_file* f = &table.files[i];
+            printf("file=%s: mapped=%lu KB, resident=%lu KB, shared=%lu KB\n",
+                   f->name, f->mapped * kb_per_page, f->resident * kb_per_page, f->shared * kb_per_page);
+        }
+    }
+
+    free(table.files);
+    free(table.slots);
 }
 
 /*void alltablesize(int pid)
@@ -729,12 +2483,39 @@ uint64_t pfn_va_formatter(char* arg)
 
 int main(int argc, char* argv[]) 
 {
+    // --format=text|jsonl|bin may appear anywhere; drop it from argv
+    int nargs = 0;
+    for (int i = 0; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--format=", 9))
+        {
+            argv[nargs++] = argv[i];
+            continue;
+        }
+
+        const char* format = argv[i] + 9;
+        if (!strcmp(format, "text"))
+            output_format = FORMAT_TEXT;
+        else if (!strcmp(format, "jsonl"))
+            output_format = FORMAT_JSONL;
+        else if (!strcmp(format, "bin"))
+            output_format = FORMAT_BIN;
+        else
+        {
+            fprintf(diag(), "Invalid format: %s\n", format);
+            return -1;
+        }
+    }
+    argc = nargs;
+
     if (argc < 3) 
     {
-        printf("Please provide valid arguments\n");
+        fprintf(diag(), "Please provide valid arguments\n");
         return -1;
     }
 
+    init_paging();
+
     char* command = argv[1];
     if (!strcmp(command, "-frameinfo")) 
     {
@@ -768,9 +2549,32 @@ int main(int argc, char* argv[])
     {
         alltablesize(atoi(argv[2]));
     } 
+    else if (!strcmp(command, "-wss") && argc > 3) 
+    {
+        char* end;
+        long interval = strtol(argv[3], &end, 10);
+        if (end == argv[3] || *end != '\0' || interval <= 0 || interval > INT_MAX)
+        {
+            fprintf(diag(), "Invalid interval: %s (expected a positive number of seconds)\n", argv[3]);
+            return -1;
+        }
+        wss(atoi(argv[2]), interval);
+    } 
+    else if (!strcmp(command, "-contiguity")) 
+    {
+        contiguity(atoi(argv[2]));
+    } 
+    else if (!strcmp(command, "-swapmap")) 
+    {
+        swapmap(atoi(argv[2]));
+    } 
+    else if (!strcmp(command, "-fileres")) 
+    {
+        fileres(argv[2]);
+    } 
     else 
     {
-        printf("Invalid command\n");
+        fprintf(diag(), "Invalid command\n");
         return -1;
     }
 